@@ -0,0 +1,361 @@
+#include "localization.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// --- Tuning for fusion and smoothing ---
+const double MAX_REPROJ_ERROR_PX = 4.0;  // Reject poses whose corners do not fit the model
+const float SMOOTHING_ALPHA = 0.3f;      // Weight of the newest fix in the running estimate
+const float SNAP_DISTANCE_M = 1.5f;      // Jumps larger than this restart smoothing instead of blending
+const int MAX_COAST_FRAMES = 15;         // Frames without a fix before the pose is dropped
+const double AMBIGUITY_MARGIN_PX = 1.0;  // IPPE solutions this close in error are treated as equally likely
+const float AGREEMENT_DISTANCE_M = 0.5f; // Fixes from different codes this close count as agreeing
+const double FLIP_EVIDENCE_DECAY = 0.8;  // Per-frame decay of the reprojection lead of the other IPPE solution
+const double FLIP_SWITCH_PX = 0.5;       // Accumulated lead at which a single code switches to the other solution
+
+static cv::Point2f quadCenter(const std::vector<cv::Point2f>& corners) {
+    return (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f;
+}
+
+static float toRadians(float degrees) { return degrees * (float)CV_PI / 180.0f; }
+static float toDegrees(float radians) { return radians * 180.0f / (float)CV_PI; }
+
+bool QRLocalizer::loadCalibration(const std::string& path, const std::map<std::string, cv::Point>& nodePositions) {
+    cv::FileStorage fs;
+    try {
+        fs.open(path, cv::FileStorage::READ);
+    } catch (const cv::Exception& e) {
+        std::cerr << "Error: Could not parse calibration file. " << e.what() << std::endl;
+        return false;
+    }
+    if (!fs.isOpened()) {
+        std::cerr << "Warning: Calibration file not found: " << path << std::endl;
+        return false;
+    }
+
+    cv::Mat K, D;
+    fs["camera_matrix"] >> K;
+    fs["distortion_coefficients"] >> D;
+    if (K.rows != 3 || K.cols != 3) {
+        std::cerr << "Error: Calibration file has no valid camera_matrix." << std::endl;
+        return false;
+    }
+    cv::Size imageSize((int)fs["image_width"], (int)fs["image_height"]);
+    if (imageSize.area() <= 0) {
+        std::cerr << "Warning: Calibration file has no image_width/image_height; assuming it matches the camera." << std::endl;
+    }
+    float borderSide = DEFAULT_QR_BORDER_SIDE_M;
+    if (!fs["qr_border_side_m"].empty()) fs["qr_border_side_m"] >> borderSide;
+    if (borderSide <= 0.0f) {
+        std::cerr << "Error: Calibration file has a non-positive qr_border_side_m." << std::endl;
+        return false;
+    }
+    float pixelsPerMeter = 0.0f;
+    if (!fs["map_pixels_per_meter"].empty()) fs["map_pixels_per_meter"] >> pixelsPerMeter;
+
+    cv::FileNode anchorList = fs["anchors"];
+    if (anchorList.size() > 0 && pixelsPerMeter <= 0.0f) {
+        std::cerr << "Error: Calibration file lists anchors but no positive map_pixels_per_meter." << std::endl;
+        return false;
+    }
+    setCalibration(K, D, imageSize, borderSide, pixelsPerMeter);
+
+    for (const auto& item : anchorList) {
+        std::string name = (std::string)item["name"];
+        cv::Point2f position;
+        // Codes hang on walls, away from the corridor waypoint, so an explicit map x/y takes precedence
+        if (!item["x"].empty() && !item["y"].empty()) {
+            position = cv::Point2f((float)item["x"], (float)item["y"]);
+        }
+        else {
+            auto node = nodePositions.find(name);
+            if (node == nodePositions.end()) {
+                std::cerr << "Warning: Calibration anchor '" << name << "' has no x/y and is not a map node." << std::endl;
+                continue;
+            }
+            position = cv::Point2f(node->second);
+        }
+        if (item["facing_deg"].empty()) {
+            std::cerr << "Warning: Calibration anchor '" << name << "' has no facing_deg and is ignored." << std::endl;
+            continue;
+        }
+        setAnchor(name, position, (float)item["facing_deg"]);
+    }
+
+    std::cout << "Camera calibration loaded (" << anchors.size() << " QR anchors)." << std::endl;
+    return true;
+}
+
+void QRLocalizer::setCalibration(const cv::Mat& K, const cv::Mat& D, cv::Size imageSize, float borderSideMeters, float pixelsPerMeter) {
+    K.convertTo(cameraMatrix, CV_64F);
+    if (D.empty()) cv::Mat::zeros(1, 5, CV_64F).copyTo(distCoeffs);
+    else D.convertTo(distCoeffs, CV_64F);
+    calibratedSize = imageSize;
+    qrSideMeters = borderSideMeters;
+    mapPixelsPerMeter = pixelsPerMeter;
+
+    // Model corners in the order SOLVEPNP_IPPE_SQUARE expects: TL, TR, BR, BL
+    float h = qrSideMeters / 2.0f;
+    objectPoints = { {-h, h, 0.0f}, {h, h, 0.0f}, {h, -h, 0.0f}, {-h, -h, 0.0f} };
+}
+
+bool QRLocalizer::matchImageSize(cv::Size frameSize) {
+    if (isCalibrated() && (frameSize.width <= 0 || frameSize.height <= 0)) {
+        std::cerr << "Error: Camera reported no frame size; pose estimation is disabled." << std::endl;
+        cameraMatrix.release();
+        return false;
+    }
+    if (!isCalibrated() || calibratedSize.area() <= 0 || calibratedSize == frameSize) return isCalibrated();
+    double sx = (double)frameSize.width / calibratedSize.width;
+    double sy = (double)frameSize.height / calibratedSize.height;
+    if (std::abs(sx - sy) > 0.01) {
+        std::cerr << "Error: Calibration was made at " << calibratedSize << " but the camera captures " << frameSize
+                  << ". Pose estimation is disabled." << std::endl;
+        cameraMatrix.release();
+        return false;
+    }
+    // Same aspect ratio: focal lengths and principal point scale with the resolution
+    cameraMatrix.row(0) = cameraMatrix.row(0) * sx;
+    cameraMatrix.row(1) = cameraMatrix.row(1) * sy;
+    std::cerr << "Warning: Calibration was made at " << calibratedSize << ", rescaled to " << frameSize << "." << std::endl;
+    calibratedSize = frameSize;
+    return true;
+}
+
+void QRLocalizer::setAnchor(const std::string& label, cv::Point2f position, float facingDeg) {
+    anchors[label] = { position, facingDeg };
+}
+
+std::vector<CodePose> QRLocalizer::estimateCodePoses(const std::vector<cv::Point2f>& corners) const {
+    std::vector<CodePose> poses;
+    if (!isCalibrated() || corners.size() != 4) return poses;
+    std::vector<cv::Mat> rvecs, tvecs;
+    cv::solvePnPGeneric(objectPoints, corners, cameraMatrix, distCoeffs, rvecs, tvecs, false, cv::SOLVEPNP_IPPE_SQUARE);
+
+    for (size_t k = 0; k < rvecs.size(); ++k) {
+        CodePose pose;
+        pose.rvec = rvecs[k];
+        pose.tvec = tvecs[k];
+
+        std::vector<cv::Point2f> projected;
+        cv::projectPoints(objectPoints, pose.rvec, pose.tvec, cameraMatrix, distCoeffs, projected);
+        double sumSq = 0.0;
+        for (size_t i = 0; i < corners.size(); ++i) {
+            cv::Point2f d = projected[i] - corners[i];
+            sumSq += d.dot(d);
+        }
+        pose.reprojError = std::sqrt(sumSq / corners.size());
+
+        cv::Matx33d R;
+        cv::Rodrigues(pose.rvec, R);
+        cv::Vec3d c = -(R.t() * pose.tvec);
+        pose.cameraInCode = { c[0], c[1], c[2] };
+        pose.distance = cv::norm(pose.tvec);
+        pose.bearingDeg = toDegrees((float)std::atan2(pose.tvec[0], pose.tvec[2]));
+        // A camera behind the wall is the mirrored solution
+        pose.valid = c[2] > 0.0 && pose.reprojError < MAX_REPROJ_ERROR_PX;
+        if (pose.valid) poses.push_back(pose);
+    }
+    std::sort(poses.begin(), poses.end(), [](const CodePose& a, const CodePose& b) { return a.reprojError < b.reprojError; });
+    return poses;
+}
+
+CodePose QRLocalizer::estimateCodePose(const std::vector<cv::Point2f>& corners) const {
+    std::vector<CodePose> poses = estimateCodePoses(corners);
+    return poses.empty() ? CodePose() : poses.front();
+}
+
+bool QRLocalizer::toMapPose(const Anchor& anchor, const CodePose& pose, cv::Point2f& position, cv::Point2f& heading) const {
+    float facing = toRadians(anchor.facingDeg);
+    cv::Point2f normal(std::cos(facing), std::sin(facing));
+    // The code's +x axis is the viewer's right when facing the wall
+    cv::Point2f right(normal.y, -normal.x);
+
+    position = anchor.position + mapPixelsPerMeter *
+        ((float)pose.cameraInCode.x * right + (float)pose.cameraInCode.z * normal);
+
+    // The optical axis in the code frame is R^T * (0, 0, 1), i.e. the last row of R
+    cv::Matx33d R;
+    cv::Rodrigues(pose.rvec, R);
+    cv::Point2f axis = (float)R(2, 0) * right + (float)R(2, 2) * normal;
+    float length = (float)cv::norm(axis);
+    if (length < 1e-3f) return false;  // Looking straight up or down, heading is undefined
+    heading = axis / length;
+    return true;
+}
+
+void QRLocalizer::carryOverLabels(std::vector<CodeObservation>& observations) const {
+    std::vector<bool> taken(tracked.size(), false);
+    for (const auto& obs : observations) {
+        for (size_t i = 0; i < tracked.size(); ++i) {
+            if (!obs.label.empty() && tracked[i].label == obs.label) taken[i] = true;
+        }
+    }
+
+    // Codes move little between frames, so the nearest previous code within half its diagonal is the same one
+    for (auto& obs : observations) {
+        if (!obs.label.empty() || obs.corners.size() != 4) continue;
+        cv::Point2f center = quadCenter(obs.corners);
+        int best = -1;
+        double bestDist = 0.0;
+        for (size_t i = 0; i < tracked.size(); ++i) {
+            if (taken[i]) continue;
+            double gate = 0.5 * cv::norm(tracked[i].corners[0] - tracked[i].corners[2]);
+            double dist = cv::norm(center - quadCenter(tracked[i].corners));
+            if (dist < gate && (best < 0 || dist < bestDist)) {
+                best = (int)i;
+                bestDist = dist;
+            }
+        }
+        if (best >= 0) {
+            obs.label = tracked[best].label;
+            taken[best] = true;
+            // Image-order corners restart at whichever is top-left on screen; keep the rotation
+            // that lines up with last frame so the printed top-left stays first as the camera rolls
+            const std::vector<cv::Point2f>& previous = tracked[best].corners;
+            int bestTurn = 0;
+            double bestCost = 0.0;
+            for (int turn = 0; turn < 4; ++turn) {
+                double cost = 0.0;
+                for (int i = 0; i < 4; ++i) cost += cv::norm(obs.corners[(i + turn) % 4] - previous[i]);
+                if (turn == 0 || cost < bestCost) {
+                    bestTurn = turn;
+                    bestCost = cost;
+                }
+            }
+            std::rotate(obs.corners.begin(), obs.corners.begin() + bestTurn, obs.corners.end());
+        }
+    }
+}
+
+std::vector<QRLocalizer::Fix> QRLocalizer::candidateFixes(const CodeObservation& obs) const {
+    std::vector<Fix> fixes;
+    auto anchor = anchors.find(obs.label);
+    if (obs.label.empty() || anchor == anchors.end() || mapPixelsPerMeter <= 0.0f) return fixes;
+    for (const CodePose& pose : estimateCodePoses(obs.corners)) {
+        Fix fix;
+        if (!toMapPose(anchor->second, pose, fix.position, fix.heading)) continue;
+        // Depth error of a planar target grows with the square of its distance
+        fix.weight = 1.0f / (float)std::max(pose.distance * pose.distance, 0.01);
+        fix.reprojError = pose.reprojError;
+        fixes.push_back(fix);
+    }
+    return fixes;
+}
+
+const QRLocalizer::Fix& QRLocalizer::pickFix(const std::vector<Fix>& fixes, const cv::Point2f* reference) {
+    // Both IPPE solutions fit a small or distant code almost equally well; only then may the reference decide
+    const Fix* best = &fixes.front();
+    if (!reference) return *best;
+    for (const Fix& fix : fixes) {
+        if (fix.reprojError > fixes.front().reprojError + AMBIGUITY_MARGIN_PX) continue;
+        if (cv::norm(fix.position - *reference) < cv::norm(best->position - *reference)) best = &fix;
+    }
+    return *best;
+}
+
+MapPose QRLocalizer::update(std::vector<CodeObservation>& observations) {
+    carryOverLabels(observations);
+
+    std::vector<std::vector<Fix>> codes;
+    for (const auto& obs : observations) {
+        std::vector<Fix> fixes = candidateFixes(obs);
+        if (!fixes.empty()) codes.push_back(fixes);
+    }
+
+    // Resolve the flip ambiguity: with several codes, trust the candidate most other codes agree with;
+    // with one, stay near the running estimate until the other solution keeps fitting better
+    cv::Point2f consensus;
+    const cv::Point2f* reference = nullptr;
+    if (codes.size() == 1 && smoothed.valid) {
+        const Fix& followed = pickFix(codes[0], &smoothed.position);
+        const Fix* other = nullptr;
+        for (const Fix& fix : codes[0]) {
+            if (&fix != &followed && fix.reprojError <= codes[0].front().reprojError + AMBIGUITY_MARGIN_PX) other = &fix;
+        }
+        reference = &followed.position;
+        if (!other) {
+            flipEvidence = 0.0;
+        }
+        else {
+            flipEvidence = FLIP_EVIDENCE_DECAY * flipEvidence + (followed.reprojError - other->reprojError);
+            if (flipEvidence > FLIP_SWITCH_PX) {
+                // The estimate sits on the wrong side of the code; jump rather than blend across
+                reference = &other->position;
+                smoothed.valid = false;
+                flipEvidence = 0.0;
+            }
+        }
+    }
+    else {
+        flipEvidence = 0.0;
+    }
+    if (codes.size() >= 2) {
+        int bestSupport = -1;
+        double bestError = 0.0;
+        for (size_t i = 0; i < codes.size(); ++i) {
+            for (const Fix& fix : codes[i]) {
+                int support = 0;
+                for (size_t j = 0; j < codes.size(); ++j) {
+                    if (j == i) continue;
+                    for (const Fix& other : codes[j]) {
+                        if (cv::norm(other.position - fix.position) < AGREEMENT_DISTANCE_M * mapPixelsPerMeter) { ++support; break; }
+                    }
+                }
+                if (support > bestSupport || (support == bestSupport && fix.reprojError < bestError)) {
+                    bestSupport = support;
+                    bestError = fix.reprojError;
+                    consensus = fix.position;
+                }
+            }
+        }
+        reference = &consensus;
+    }
+
+    cv::Point2f positionSum(0.0f, 0.0f), headingSum(0.0f, 0.0f);
+    float weightSum = 0.0f;
+    for (const auto& fixes : codes) {
+        const Fix& fix = pickFix(fixes, reference);
+        positionSum += fix.weight * fix.position;
+        headingSum += fix.weight * fix.heading;
+        weightSum += fix.weight;
+    }
+    int used = (int)codes.size();
+
+    tracked.clear();
+    for (const auto& obs : observations) {
+        if (!obs.label.empty() && obs.corners.size() == 4) tracked.push_back(obs);
+    }
+
+    smoothed.codesUsed = used;
+    if (used == 0) {
+        if (++framesSinceFix > MAX_COAST_FRAMES) smoothed.valid = false;
+        return smoothed;
+    }
+    framesSinceFix = 0;
+
+    cv::Point2f position = positionSum / weightSum;
+    float heading = std::atan2(headingSum.y, headingSum.x);
+    bool snap = !smoothed.valid || cv::norm(position - smoothed.position) > SNAP_DISTANCE_M * mapPixelsPerMeter;
+    if (snap) {
+        smoothed.position = position;
+        smoothed.headingDeg = toDegrees(heading);
+    }
+    else {
+        smoothed.position += SMOOTHING_ALPHA * (position - smoothed.position);
+        // Blend headings as unit vectors so that 359 and 1 degrees average to 0, not 180
+        float previous = toRadians(smoothed.headingDeg);
+        cv::Point2f v = (1.0f - SMOOTHING_ALPHA) * cv::Point2f(std::cos(previous), std::sin(previous))
+            + SMOOTHING_ALPHA * cv::Point2f(std::cos(heading), std::sin(heading));
+        smoothed.headingDeg = toDegrees(std::atan2(v.y, v.x));
+    }
+    smoothed.valid = true;
+    return smoothed;
+}
+
+void QRLocalizer::reset() {
+    tracked.clear();
+    smoothed = {};
+    framesSinceFix = 0;
+    flipEvidence = 0.0;
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+// Side length of the coloured outer border that findAllQRCodes outlines (not the QR modules inside it).
+const float DEFAULT_QR_BORDER_SIDE_M = 0.15f;
+
+// Pose of the camera relative to a single QR code, from solvePnP on its four corners.
+// The code frame has x to the right, y up and z pointing out of the wall towards the viewer.
+struct CodePose {
+    cv::Vec3d rvec, tvec;          // Code-to-camera transform as returned by solvePnP
+    cv::Point3d cameraInCode;      // Camera position in the code frame (metres)
+    double distance = 0.0;         // Camera to code centre (metres)
+    double bearingDeg = 0.0;       // Code centre off the optical axis, positive = to the right
+    double reprojError = 0.0;      // RMS reprojection error (pixels)
+    bool valid = false;
+};
+
+// A QR code seen in the current frame. The label is empty until the code has been decoded;
+// QRLocalizer fills it in from earlier frames so the code does not need decoding again.
+struct CodeObservation {
+    std::string label;
+    std::vector<cv::Point2f> corners;  // Clockwise; starts at the printed top-left once labelled (alignCornersToCode)
+};
+
+// Camera position and heading in the floor map (nodeCoordinates) frame.
+struct MapPose {
+    cv::Point2f position;     // Map pixels; divide by pixelsPerMeter() for metres
+    float headingDeg = 0.0f;  // Viewing direction, atan2(dy, dx) in map pixels (y points down)
+    int codesUsed = 0;        // Number of codes fused into this estimate
+    bool valid = false;
+};
+
+// Estimates where the user is standing from the QR codes in view and smooths it over time.
+class QRLocalizer {
+public:
+    // Reads camera intrinsics, the border size, the map scale and where each code is mounted from an
+    // OpenCV YAML/XML file. Anchors without their own x/y are placed at their nodePositions entry.
+    bool loadCalibration(const std::string& path, const std::map<std::string, cv::Point>& nodePositions);
+    void setCalibration(const cv::Mat& K, const cv::Mat& D, cv::Size imageSize, float borderSideMeters, float pixelsPerMeter);
+    bool isCalibrated() const { return !cameraMatrix.empty(); }
+    float pixelsPerMeter() const { return mapPixelsPerMeter; }
+    float borderSideMeters() const { return qrSideMeters; }
+
+    // Checks the intrinsics against the capture resolution. Rescales them when only the scale differs,
+    // drops the calibration when the aspect ratio differs or the size is unknown (0x0).
+    // Returns whether the camera is still calibrated.
+    bool matchImageSize(cv::Size frameSize);
+
+    // Mounts a code on the map. facingDeg is the direction its face points, same convention as headingDeg.
+    void setAnchor(const std::string& label, cv::Point2f position, float facingDeg);
+
+    // Camera pose relative to one code. Needs only the corners, not a decode. Distance and bearing
+    // hold for any corner rotation; the rest of the pose needs corners[0] at the printed top-left.
+    CodePose estimateCodePose(const std::vector<cv::Point2f>& corners) const;
+
+    // Every plausible pose for one code, lowest reprojection error first. A planar square has two
+    // IPPE solutions that fit almost equally well when it is small or far away.
+    std::vector<CodePose> estimateCodePoses(const std::vector<cv::Point2f>& corners) const;
+
+    // Labels unlabelled codes that match one from the previous frame, rotating their corners to
+    // keep its orientation. update() does this itself; call it first to skip decoding those codes.
+    void carryOverLabels(std::vector<CodeObservation>& observations) const;
+
+    // Carries labels over from the previous frame, fuses every anchored code in view and
+    // returns the smoothed map pose. Call once per frame, even when nothing is visible.
+    MapPose update(std::vector<CodeObservation>& observations);
+
+    MapPose currentPose() const { return smoothed; }
+    void reset();
+
+private:
+    struct Anchor { cv::Point2f position; float facingDeg; };
+    struct Fix { cv::Point2f position, heading; float weight = 0.0f; double reprojError = 0.0; };
+
+    bool toMapPose(const Anchor& anchor, const CodePose& pose, cv::Point2f& position, cv::Point2f& heading) const;
+    std::vector<Fix> candidateFixes(const CodeObservation& obs) const;
+    static const Fix& pickFix(const std::vector<Fix>& fixes, const cv::Point2f* reference);
+
+    cv::Mat cameraMatrix, distCoeffs;
+    cv::Size calibratedSize;  // Empty when the file does not record it
+    std::vector<cv::Point3f> objectPoints;
+    float qrSideMeters = DEFAULT_QR_BORDER_SIDE_M;
+    float mapPixelsPerMeter = 0.0f;  // Required whenever anchors are used
+    std::map<std::string, Anchor> anchors;
+
+    std::vector<CodeObservation> tracked;  // Labelled codes from the previous frame
+    MapPose smoothed;
+    int framesSinceFix = 0;
+    double flipEvidence = 0.0;  // How much better the unfollowed IPPE solution has fitted lately (pixels)
+};
\ No newline at end of file
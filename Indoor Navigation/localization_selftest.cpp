@@ -0,0 +1,270 @@
+#include "localization_selftest.h"
+#include "localization.h"
+#include "qr_detection.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// --- Synthetic scene: a 640x480 camera held at 1.3 m, codes mounted at 1.5 m ---
+const cv::Size IMAGE_SIZE(640, 480);
+const float MAP_PIXELS_PER_METER = 20.0f;
+const double CAMERA_HEIGHT_M = 1.3;
+const double CODE_HEIGHT_M = 1.5;
+const double CORNER_NOISE_PX = 0.5;  // Roughly what approxPolyDP's integer corners add
+
+static double radians(double degrees) { return degrees * CV_PI / 180.0; }
+
+static double angleError(double a, double b) {
+    double d = std::fmod(a - b + 540.0, 360.0) - 180.0;
+    return std::abs(d);
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1))];
+}
+
+// World frame: map x and y in metres (y points down the map), z points down.
+struct SyntheticCamera {
+    cv::Point2f mapPosition;  // Map pixels
+    double headingDeg;
+    cv::Matx33d worldToCamera;
+};
+
+static SyntheticCamera makeCamera(cv::Point2f mapPosition, double headingDeg, double pitchDeg, double rollDeg) {
+    double h = radians(headingDeg), p = radians(pitchDeg), r = radians(rollDeg);
+    cv::Vec3d forward(std::cos(h), std::sin(h), 0.0), right(-std::sin(h), std::cos(h), 0.0), down(0.0, 0.0, 1.0);
+    cv::Vec3d pitched = forward * std::cos(p) - down * std::sin(p);
+    cv::Vec3d pitchedDown = pitched.cross(right);
+    cv::Vec3d rolledRight = right * std::cos(r) + pitchedDown * std::sin(r);
+    cv::Vec3d rolledDown = pitchedDown * std::cos(r) - right * std::sin(r);
+    SyntheticCamera camera;
+    camera.mapPosition = mapPosition;
+    camera.headingDeg = headingDeg;
+    camera.worldToCamera = cv::Matx33d(rolledRight[0], rolledRight[1], rolledRight[2],
+                                       rolledDown[0], rolledDown[1], rolledDown[2],
+                                       pitched[0], pitched[1], pitched[2]);
+    return camera;
+}
+
+// Projects a code's printed TL, TR, BR, BL corners. Returns false when any corner is off screen.
+static bool projectCode(const SyntheticCamera& camera, const cv::Matx33d& K, cv::Point2f anchor, double facingDeg,
+                        std::vector<cv::Point2f>& corners) {
+    double f = radians(facingDeg), h = DEFAULT_QR_BORDER_SIDE_M / 2.0;
+    cv::Vec3d normal(std::cos(f), std::sin(f), 0.0), codeRight(normal[1], -normal[0], 0.0), up(0.0, 0.0, -1.0);
+    cv::Vec3d center(anchor.x / MAP_PIXELS_PER_METER, anchor.y / MAP_PIXELS_PER_METER, -CODE_HEIGHT_M);
+    cv::Vec3d eye(camera.mapPosition.x / MAP_PIXELS_PER_METER, camera.mapPosition.y / MAP_PIXELS_PER_METER, -CAMERA_HEIGHT_M);
+    const cv::Vec3d world[4] = { center - codeRight * h + up * h, center + codeRight * h + up * h,
+                                 center + codeRight * h - up * h, center - codeRight * h - up * h };
+    corners.clear();
+    for (const auto& w : world) {
+        cv::Vec3d x = camera.worldToCamera * (w - eye);
+        if (x[2] < 0.1) return false;
+        cv::Point2f px((float)(K(0, 0) * x[0] / x[2] + K(0, 2)), (float)(K(1, 1) * x[1] / x[2] + K(1, 2)));
+        if (px.x < 0 || px.y < 0 || px.x >= IMAGE_SIZE.width || px.y >= IMAGE_SIZE.height) return false;
+        corners.push_back(px);
+    }
+    return true;
+}
+
+static void addNoise(std::vector<cv::Point2f>& corners, cv::RNG& rng) {
+    for (auto& c : corners) c += cv::Point2f((float)rng.gaussian(CORNER_NOISE_PX), (float)rng.gaussian(CORNER_NOISE_PX));
+}
+
+static double positionError(const MapPose& pose, const SyntheticCamera& camera) {
+    return cv::norm(pose.position - camera.mapPosition) / MAP_PIXELS_PER_METER;
+}
+
+static bool check(bool passed, const std::string& name) {
+    std::cout << (passed ? "[PASS] " : "[FAIL] ") << name << std::endl;
+    return passed;
+}
+
+bool runLocalizationSelfTest() {
+    const cv::Matx33d K(650.0, 0.0, 320.0, 0.0, 650.0, 240.0, 0.0, 0.0, 1.0);
+    const cv::Point2f codeA(1000.0f, 600.0f);
+    cv::RNG rng(26);
+    bool ok = true;
+
+    QRLocalizer localizer;
+    localizer.setCalibration(cv::Mat(K), cv::Mat(), IMAGE_SIZE, DEFAULT_QR_BORDER_SIDE_M, MAP_PIXELS_PER_METER);
+
+    // --- Single code: random standpoint 0.8-3 m away, up to 50 degrees off-axis, any camera roll ---
+    std::vector<double> posErrors, headErrors;
+    for (int trial = 0; trial < 500; ++trial) {
+        double facing = rng.uniform(0.0, 360.0);
+        localizer.setAnchor("A", codeA, (float)facing);
+        SyntheticCamera camera;
+        std::vector<cv::Point2f> corners;
+        do {
+            double dist = rng.uniform(0.8, 3.0), off = radians(facing + rng.uniform(-50.0, 50.0));
+            cv::Point2f standpoint = codeA + MAP_PIXELS_PER_METER * (float)dist * cv::Point2f((float)std::cos(off), (float)std::sin(off));
+            double towardCode = std::atan2(codeA.y - standpoint.y, codeA.x - standpoint.x) * 180.0 / CV_PI;
+            camera = makeCamera(standpoint, towardCode + rng.uniform(-15.0, 15.0), rng.uniform(-10.0, 10.0), rng.uniform(-180.0, 180.0));
+        } while (!projectCode(camera, K, codeA, facing, corners));
+        addNoise(corners, rng);
+
+        localizer.reset();
+        std::vector<CodeObservation> observations = { { "A", corners } };
+        MapPose pose = localizer.update(observations);
+        if (!pose.valid) { posErrors.push_back(1e9); continue; }
+        posErrors.push_back(positionError(pose, camera));
+        headErrors.push_back(angleError(pose.headingDeg, camera.headingDeg));
+    }
+    std::cout << "Single code: position error median " << percentile(posErrors, 0.5) << " m, 75th pct " << percentile(posErrors, 0.75)
+              << " m; heading error median " << percentile(headErrors, 0.5) << " deg" << std::endl;
+    ok &= check(percentile(posErrors, 0.5) < 0.10 && percentile(posErrors, 0.75) < 0.25, "single-code position accuracy");
+    ok &= check(percentile(headErrors, 0.5) < 2.5, "single-code heading accuracy");
+
+    // --- Orientation: the printed top-left is found whichever way the code is turned in the warp ---
+    const std::vector<cv::Point2f> printed = { {10, 10}, {50, 12}, {52, 48}, {8, 50} };
+    const cv::Point2f warpCorners[4] = { {0, 0}, {200, 0}, {200, 200}, {0, 200} };
+    bool aligned = true;
+    for (int turn = 0; turn < 4; ++turn) {
+        std::vector<cv::Point2f> imageOrder = printed;
+        std::rotate(imageOrder.rbegin(), imageOrder.rbegin() + turn, imageOrder.rend());
+        // QRCodeDetector reports the printed top-left a little inside the warp corner it landed on
+        cv::Point2f topLeft = warpCorners[turn] + 0.2f * (cv::Point2f(100, 100) - warpCorners[turn]);
+        std::vector<cv::Point2f> codePoints = { topLeft, topLeft, topLeft, topLeft };
+        aligned &= alignCornersToCode(imageOrder, codePoints) == printed;
+    }
+    ok &= check(aligned, "corner alignment from finder patterns");
+
+    // --- Carry-over: a decoded code keeps its label and orientation while the camera rolls past 45 degrees ---
+    {
+        localizer.setAnchor("A", codeA, 90.0f);
+        cv::Point2f standpoint = codeA + cv::Point2f(0.0f, 1.5f * MAP_PIXELS_PER_METER);
+        std::vector<cv::Point2f> before, after;
+        projectCode(makeCamera(standpoint, -90.0, 0.0, 40.0), K, codeA, 90.0, before);
+        SyntheticCamera rolled = makeCamera(standpoint, -90.0, 0.0, 50.0);
+        projectCode(rolled, K, codeA, 90.0, after);
+        std::rotate(after.begin(), after.begin() + 1, after.end());  // Image order now starts at another corner
+
+        localizer.reset();
+        std::vector<CodeObservation> first = { { "A", before } };
+        localizer.update(first);
+        std::vector<CodeObservation> second = { { "", after } };
+        MapPose pose = localizer.update(second);
+        ok &= check(second[0].label == "A" && pose.codesUsed == 1 && positionError(pose, rolled) < 0.05, "label and orientation carry-over");
+    }
+
+    // --- Fusion: two codes 1.2 m apart on one wall beat either code alone ---
+    std::vector<double> singleErrors, fusedErrors;
+    for (int trial = 0; trial < 300; ++trial) {
+        double facing = rng.uniform(0.0, 360.0), f = radians(facing);
+        cv::Point2f along((float)std::sin(f), (float)-std::cos(f));
+        cv::Point2f codeB = codeA + 1.2f * MAP_PIXELS_PER_METER * along;
+        cv::Point2f middle = (codeA + codeB) * 0.5f;
+        localizer.setAnchor("A", codeA, (float)facing);
+        localizer.setAnchor("B", codeB, (float)facing);
+        SyntheticCamera camera;
+        std::vector<cv::Point2f> cornersA, cornersB;
+        do {
+            double dist = rng.uniform(1.5, 3.0), off = radians(facing + rng.uniform(-30.0, 30.0));
+            cv::Point2f standpoint = middle + MAP_PIXELS_PER_METER * (float)dist * cv::Point2f((float)std::cos(off), (float)std::sin(off));
+            double towardCodes = std::atan2(middle.y - standpoint.y, middle.x - standpoint.x) * 180.0 / CV_PI;
+            camera = makeCamera(standpoint, towardCodes + rng.uniform(-5.0, 5.0), rng.uniform(-10.0, 10.0), rng.uniform(-180.0, 180.0));
+        } while (!projectCode(camera, K, codeA, facing, cornersA) || !projectCode(camera, K, codeB, facing, cornersB));
+        addNoise(cornersA, rng);
+        addNoise(cornersB, rng);
+
+        localizer.reset();
+        std::vector<CodeObservation> single = { { "A", cornersA } };
+        MapPose alone = localizer.update(single);
+        singleErrors.push_back(alone.valid ? positionError(alone, camera) : 1e9);
+        localizer.reset();
+        std::vector<CodeObservation> both = { { "A", cornersA }, { "B", cornersB } };
+        MapPose fused = localizer.update(both);
+        fusedErrors.push_back(fused.valid ? positionError(fused, camera) : 1e9);
+    }
+    std::cout << "Two codes: single median " << percentile(singleErrors, 0.5) << " m, fused median " << percentile(fusedErrors, 0.5)
+              << " m; single 75th pct " << percentile(singleErrors, 0.75) << " m, fused 75th pct " << percentile(fusedErrors, 0.75) << " m" << std::endl;
+    ok &= check(percentile(fusedErrors, 0.5) < percentile(singleErrors, 0.5) && percentile(fusedErrors, 0.75) < percentile(singleErrors, 0.75),
+                "multi-code fusion");
+
+    // --- Smoothing: for a steady camera 2 m away, no sequence may end up worse than the raw per-frame fixes,
+    //     even when its first frame is given the flipped IPPE solution ---
+    const float h = DEFAULT_QR_BORDER_SIDE_M / 2.0f;
+    const std::vector<cv::Point3f> model = { {-h, h, 0.0f}, {h, h, 0.0f}, {h, -h, 0.0f}, {-h, -h, 0.0f} };
+    for (int flippedStart = 0; flippedStart < 2; ++flippedStart) {
+        int sequences = 0, worse = 0;
+        double worstGap = 0.0;
+        for (int trial = 0; trial < 40; ++trial) {
+            double facing = rng.uniform(0.0, 360.0), off = radians(facing + rng.uniform(-50.0, 50.0));
+            localizer.setAnchor("A", codeA, (float)facing);
+            cv::Point2f standpoint = codeA + 2.0f * MAP_PIXELS_PER_METER * cv::Point2f((float)std::cos(off), (float)std::sin(off));
+            SyntheticCamera camera = makeCamera(standpoint, std::atan2(codeA.y - standpoint.y, codeA.x - standpoint.x) * 180.0 / CV_PI, 0.0, rng.uniform(-180.0, 180.0));
+            std::vector<cv::Point2f> clean;
+            if (!projectCode(camera, K, codeA, facing, clean)) continue;
+
+            localizer.reset();
+            if (flippedStart) {
+                // Render the view the wrong solution describes, so the first fix lands on the wrong side of the code
+                std::vector<CodePose> poses = localizer.estimateCodePoses(clean);
+                if (poses.size() < 2) continue;
+                std::vector<cv::Point2f> flipped;
+                cv::projectPoints(model, poses.back().rvec, poses.back().tvec, cv::Mat(K), cv::noArray(), flipped);
+                std::vector<CodeObservation> first = { { "A", flipped } };
+                localizer.update(first);
+            }
+
+            QRLocalizer raw;
+            raw.setCalibration(cv::Mat(K), cv::Mat(), IMAGE_SIZE, DEFAULT_QR_BORDER_SIDE_M, MAP_PIXELS_PER_METER);
+            raw.setAnchor("A", codeA, (float)facing);
+            double rawSum = 0.0, smoothSum = 0.0;
+            int samples = 0;
+            for (int frame = 0; frame < 60; ++frame) {
+                std::vector<cv::Point2f> corners = clean;
+                addNoise(corners, rng);
+                std::vector<CodeObservation> observations = { { "A", corners } }, rawObservations = observations;
+                MapPose smoothedPose = localizer.update(observations);
+                raw.reset();
+                MapPose rawPose = raw.update(rawObservations);
+                if (frame < 20 || !smoothedPose.valid || !rawPose.valid) continue;
+                rawSum += positionError(rawPose, camera);
+                smoothSum += positionError(smoothedPose, camera);
+                ++samples;
+            }
+            if (samples == 0) continue;
+            ++sequences;
+            double gap = (smoothSum - rawSum) / samples;
+            worstGap = std::max(worstGap, gap);
+            if (gap > 0.05) ++worse;
+        }
+        std::string name = flippedStart ? "temporal smoothing from a flipped first frame" : "temporal smoothing";
+        std::cout << (flippedStart ? "Flipped start: " : "Steady camera: ") << worse << " of " << sequences
+                  << " sequences more than 5 cm worse than raw fixes; worst mean gap " << worstGap << " m" << std::endl;
+        ok &= check(sequences > 0 && worse == 0, name);
+    }
+
+    // --- Per-frame cost ---
+    {
+        localizer.setAnchor("A", codeA, 90.0f);
+        localizer.setAnchor("B", codeA + cv::Point2f(1.2f * MAP_PIXELS_PER_METER, 0.0f), 90.0f);
+        cv::Point2f standpoint = codeA + cv::Point2f(0.6f * MAP_PIXELS_PER_METER, 2.0f * MAP_PIXELS_PER_METER);
+        SyntheticCamera camera = makeCamera(standpoint, -90.0, 0.0, 0.0);
+        std::vector<cv::Point2f> cornersA, cornersB;
+        projectCode(camera, K, codeA, 90.0, cornersA);
+        projectCode(camera, K, codeA + cv::Point2f(1.2f * MAP_PIXELS_PER_METER, 0.0f), 90.0, cornersB);
+
+        const int iterations = 5000;
+        cv::TickMeter timer;
+        timer.start();
+        for (int i = 0; i < iterations; ++i) localizer.estimateCodePose(cornersA);
+        timer.stop();
+        std::cout << "estimateCodePose: " << timer.getTimeMicro() / iterations << " us per code" << std::endl;
+
+        timer.reset();
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            std::vector<CodeObservation> observations = { { "A", cornersA }, { "B", cornersB } };
+            localizer.update(observations);
+        }
+        timer.stop();
+        std::cout << "update (2 codes, fused and smoothed): " << timer.getTimeMicro() / iterations << " us per frame" << std::endl;
+    }
+
+    std::cout << (ok ? "Localization self-test passed." : "Localization self-test FAILED.") << std::endl;
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+// Checks QRLocalizer against synthetic views with a known camera pose and times the per-frame
+// pose cost. Needs no camera or calibration file. Run with "Indoor Navigation.exe --self-test".
+// Returns true when every check passes.
+bool runLocalizationSelfTest();
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <vector>
 
 #include "qr_detection.h"
+#include "localization.h"
+#include "localization_selftest.h"
 #include "qr_reader.h"
 #include "route_guidance.h"
 #include "ui_vi.h"
@@ -17,10 +19,13 @@
 using namespace cv;
 using namespace std;
 
-// --- Constants for Distance Estimation ---
-const float KNOWN_QR_WIDTH_CM = 15.0f;
+// --- Constants for Distance Estimation (the border size comes from the localizer) ---
 const float FOCAL_LENGTH = 650.0f;
 
+// --- Spoken feedback ---
+const int SPEECH_DELAY_SECONDS = 3;     // Minimum gap between spoken updates
+const float ARRIVAL_RADIUS_M = 1.5f;    // Live guidance announces arrival within this distance
+
 // High-precision coordinates for all nodes
 map<string, Point> nodeCoordinates = {
     {"Right Corner of N001", Point(1600, 631)},
@@ -53,9 +58,9 @@ vector<string> destinationNodes = {
     "Toilets Near N008", "N009", "N010", "N011", "N012", "Toilets Near N012"
 };
 
-// === Function to compute vector and distance feedback ===
-string computeDirectionFeedback(Point frameCenter, Point qrCenter, float qrPixelWidth) {
-    float distance = (KNOWN_QR_WIDTH_CM * FOCAL_LENGTH) / qrPixelWidth;
+// === Function to compute vector and distance feedback (fallback when the camera is not calibrated) ===
+string computeDirectionFeedback(Point frameCenter, Point qrCenter, float qrPixelWidth, float qrWidthCm) {
+    float distance = (qrWidthCm * FOCAL_LENGTH) / qrPixelWidth;
     string dist_str = to_string((int)distance) + " centimeters away. ";
 
     int dx = qrCenter.x - frameCenter.x;
@@ -64,10 +69,53 @@ string computeDirectionFeedback(Point frameCenter, Point qrCenter, float qrPixel
     return "Move camera to the left. " + dist_str;
 }
 
+// === Same feedback from the solvePnP pose, which stays correct when the code is seen at an angle ===
+string computePoseFeedback(const CodePose& pose) {
+    string dist_str = to_string((int)(pose.distance * 100.0)) + " centimeters away. ";
+    if (abs(pose.bearingDeg) < 5.0) return "Aligned. " + dist_str;
+    if (pose.bearingDeg > 0.0) return "Move camera to the right. " + dist_str;
+    return "Move camera to the left. " + dist_str;
+}
+
+// === Spoken distance and direction from the fused pose to a map point ===
+string describeTarget(const MapPose& pose, const string& name, Point target, float pixelsPerMeter) {
+    Point2f offset = Point2f(target) - pose.position;
+    int meters = (int)round(norm(offset) / pixelsPerMeter);
+    // Map y points down, so a positive angle from the heading is to the user's right
+    float bearing = atan2(offset.y, offset.x) * 180.0f / (float)CV_PI - pose.headingDeg;
+    bearing = fmod(bearing + 540.0f, 360.0f) - 180.0f;
+    string direction;
+    if (abs(bearing) < 20.0f) direction = "straight ahead";
+    else if (abs(bearing) < 60.0f) direction = bearing > 0 ? "ahead on your right" : "ahead on your left";
+    else if (abs(bearing) < 135.0f) direction = bearing > 0 ? "to your right" : "to your left";
+    else direction = "behind you";
+    return name + " is " + to_string(meters) + " meters " + direction + ". ";
+}
+
+// === Next route node to walk to: the closest node, or the one after it once the user has passed it ===
+size_t nextRouteIndex(const vector<string>& path, const MapPose& pose) {
+    size_t nearest = 0;
+    for (size_t i = 1; i < path.size(); ++i) {
+        if (norm(Point2f(nodeCoordinates.at(path[i])) - pose.position) < norm(Point2f(nodeCoordinates.at(path[nearest])) - pose.position)) nearest = i;
+    }
+    if (nearest + 1 >= path.size()) return nearest;
+    Point2f nearestPt = nodeCoordinates.at(path[nearest]), followingPt = nodeCoordinates.at(path[nearest + 1]);
+    bool passed = norm(followingPt - pose.position) <= norm(followingPt - nearestPt);
+    return passed ? nearest + 1 : nearest;
+}
+
+// === Draw the estimated position and facing direction on the map ===
+void drawUserPose(Mat& mapImg, const MapPose& userPose) {
+    if (!userPose.valid) return;
+    float heading = userPose.headingDeg * (float)CV_PI / 180.0f;
+    Point2f tip = userPose.position + 40.0f * Point2f(cos(heading), sin(heading));
+    arrowedLine(mapImg, userPose.position, tip, Scalar(255, 0, 0), 3, LINE_AA, 0, 0.3);
+}
+
 // === Draw route graphically on map ===
-// Change the return type to bool
-bool drawRouteOnMap(const vector<string>& path, const string& mapPath, const string& start, const string& end) {
-    Mat mapImg = imread(mapPath);
+// Change the return type to bool; the drawn map is returned so live guidance can redraw the pose on it
+bool drawRouteOnMap(const vector<string>& path, const string& mapPath, const string& start, const string& end, Mat& mapImg) {
+    mapImg = imread(mapPath);
     if (mapImg.empty()) {
         cerr << "FATAL ERROR: Could not load map image from path: " << mapPath << endl;
         Speak("Fatal error. Map image not found.");
@@ -146,55 +194,147 @@ string generateRouteNarration(const vector<string>& path) {
     return narration;
 }
 
-// === Scanning function with controlled feedback ===
-string startScanningSequence(VideoCapture& cap) {
-    Speak("Starting scanner. Please pan your camera around to find a QR code.");
-    auto lastSpokenTime = chrono::steady_clock::now();
-    const int SPEECH_DELAY_SECONDS = 3;
-    map<string, pair<Scalar, Scalar>> colorRanges = {
+// === Colour mask and QR code candidates for one camera frame ===
+vector<QRCodeResult> detectQRCodes(const Mat& frame) {
+    static const map<string, pair<Scalar, Scalar>> colorRanges = {
         {"blue", {Scalar(100, 150, 50), Scalar(140, 255, 255)}},
         {"green", {Scalar(40, 70, 50), Scalar(80, 255, 255)}}
     };
-    Mat frame, hsv;
+    Mat hsv;
+    cvtColor(frame, hsv, COLOR_BGR2HSV);
+    vector<Mat> hsv_channels;
+    split(hsv, hsv_channels);
+    equalizeHist(hsv_channels[2], hsv_channels[2]);
+    merge(hsv_channels, hsv);
+    Mat combined_mask;
+    Mat mask_red1, mask_red2;
+    inRange(hsv, Scalar(0, 120, 70), Scalar(10, 255, 255), mask_red1);
+    inRange(hsv, Scalar(170, 120, 70), Scalar(179, 255, 255), mask_red2);
+    combined_mask = mask_red1 | mask_red2;
+    for (const auto& color_pair : colorRanges) { Mat mask; inRange(hsv, color_pair.second.first, color_pair.second.second, mask); combined_mask |= mask; }
+    morphologyEx(combined_mask, combined_mask, MORPH_CLOSE, getStructuringElement(MORPH_ELLIPSE, Size(10, 10)));
+    return findAllQRCodes(frame, combined_mask);
+}
+
+// === Label the codes in view and update the fused pose ===
+// Codes tracked from the previous frame keep their label; only new, large enough codes are decoded.
+// location is set to the label of the largest labelled code, or left empty.
+MapPose localizeFrame(const vector<QRCodeResult>& qrResults, QRLocalizer& localizer, string& location) {
+    vector<CodeObservation> observations;
+    for (const auto& result : qrResults) observations.push_back({ "", result.corners });
+    localizer.carryOverLabels(observations);
+    for (size_t i = 0; i < qrResults.size(); ++i) {
+        if (!observations[i].label.empty() || qrResults[i].pixelWidth <= 150) continue;
+        vector<Point2f> codePoints;
+        string qrData = readQRCode(qrResults[i].warpedImage, codePoints);
+        if (!qrData.empty()) observations[i] = { qrData, alignCornersToCode(qrResults[i].corners, codePoints) };
+    }
+    location = "";
+    for (const auto& obs : observations) {
+        if (!obs.label.empty()) { location = obs.label; break; }
+    }
+    return localizer.update(observations);
+}
+
+// === Scanning function with controlled feedback ===
+string startScanningSequence(VideoCapture& cap, QRLocalizer& localizer) {
+    Speak("Starting scanner. Please pan your camera around to find a QR code.");
+    localizer.reset(); // The camera has moved since the last scan, so old tracks no longer apply
+    auto lastSpokenTime = chrono::steady_clock::now();
+    const int POSE_SETTLE_FRAMES = 10; // Keep tracking briefly after the first decode so the pose can fuse and settle
+    string currentLocation;
+    int settleFrames = 0;
+    Mat frame;
     while (true) {
         cap >> frame;
         if (frame.empty()) { cerr << "Camera feed lost." << endl; Speak("Camera feed lost."); return ""; }
-        cvtColor(frame, hsv, COLOR_BGR2HSV);
-        vector<Mat> hsv_channels;
-        split(hsv, hsv_channels);
-        equalizeHist(hsv_channels[2], hsv_channels[2]);
-        merge(hsv_channels, hsv);
-        Mat combined_mask;
-        Mat mask_red1, mask_red2;
-        inRange(hsv, Scalar(0, 120, 70), Scalar(10, 255, 255), mask_red1);
-        inRange(hsv, Scalar(170, 120, 70), Scalar(179, 255, 255), mask_red2);
-        combined_mask = mask_red1 | mask_red2;
-        for (const auto& color_pair : colorRanges) { Mat mask; inRange(hsv, color_pair.second.first, color_pair.second.second, mask); combined_mask |= mask; }
-        morphologyEx(combined_mask, combined_mask, MORPH_CLOSE, getStructuringElement(MORPH_ELLIPSE, Size(10, 10)));
-        QRCodeResult qrResult = findAndWarpQRCode(frame, combined_mask);
+        vector<QRCodeResult> qrResults = detectQRCodes(frame);
         Point frameCenter(frame.cols / 2, frame.rows / 2);
-        if (qrResult.isValid()) {
-            rectangle(frame, qrResult.boundingBox, Scalar(0, 255, 0), 3);
+        if (!qrResults.empty()) {
+            const QRCodeResult& qrResult = qrResults.front();
+            for (const auto& result : qrResults) rectangle(frame, result.boundingBox, Scalar(0, 255, 0), 3);
             auto currentTime = chrono::steady_clock::now();
-            if (chrono::duration_cast<chrono::seconds>(currentTime - lastSpokenTime).count() >= SPEECH_DELAY_SECONDS) {
-                string feedback = computeDirectionFeedback(frameCenter, qrResult.boundingBox.tl() + Point(qrResult.boundingBox.width / 2, qrResult.boundingBox.height / 2), qrResult.pixelWidth);
+            if (currentLocation.empty() && chrono::duration_cast<chrono::seconds>(currentTime - lastSpokenTime).count() >= SPEECH_DELAY_SECONDS) {
+                CodePose pose = localizer.estimateCodePose(qrResult.corners);
+                string feedback = pose.valid ? computePoseFeedback(pose)
+                    : computeDirectionFeedback(frameCenter, qrResult.boundingBox.tl() + Point(qrResult.boundingBox.width / 2, qrResult.boundingBox.height / 2), qrResult.pixelWidth, localizer.borderSideMeters() * 100.0f);
                 putText(frame, feedback, Point(30, frame.rows - 30), FONT_HERSHEY_SIMPLEX, 0.7, Scalar(0, 255, 255), 2);
                 Speak(feedback);
                 lastSpokenTime = currentTime;
             }
-            if (qrResult.pixelWidth > 150) {
-                string qrData = readQRCode(qrResult.warpedImage);
-                if (!qrData.empty()) { cout << "\n✅ QR Code Decoded: " << qrData << endl; Speak("Location found. You are at " + qrData); destroyWindow("QR Scanner"); return qrData; }
-            }
+        }
+        string qrData;
+        MapPose userPose = localizeFrame(qrResults, localizer, qrData);
+        if (currentLocation.empty() && !qrData.empty()) {
+            currentLocation = qrData;
+            cout << "\n✅ QR Code Decoded: " << currentLocation << endl;
+            Speak("Location found. You are at " + currentLocation);
+        }
+        if (userPose.valid) {
+            putText(frame, "Pose: " + to_string(userPose.codesUsed) + " code(s), heading " + to_string((int)userPose.headingDeg) + " deg", Point(30, 30), FONT_HERSHEY_SIMPLEX, 0.6, Scalar(255, 0, 0), 2);
         }
         rectangle(frame, Rect(frameCenter - Point(100, 100), Size(200, 200)), Scalar(255, 255, 255), 2);
         putText(frame, "Align QR Code Here", frameCenter - Point(95, 110), FONT_HERSHEY_SIMPLEX, 0.6, Scalar(255, 255, 255), 2);
         imshow("QR Scanner", frame);
-        if (waitKey(50) == 27) { Speak("Scanning cancelled."); destroyWindow("QR Scanner"); return ""; }
+        int key = waitKey(50);
+        if (!currentLocation.empty() && (!localizer.isCalibrated() || ++settleFrames >= POSE_SETTLE_FRAMES)) {
+            if (userPose.valid) {
+                cout << "Estimated position: (" << userPose.position.x / localizer.pixelsPerMeter() << ", " << userPose.position.y / localizer.pixelsPerMeter()
+                     << ") m, heading " << (int)userPose.headingDeg << " deg" << endl;
+                auto node = nodeCoordinates.find(currentLocation);
+                if (node != nodeCoordinates.end()) Speak(describeTarget(userPose, currentLocation, node->second, localizer.pixelsPerMeter()));
+            }
+            destroyWindow("QR Scanner");
+            return currentLocation;
+        }
+        if (key == 27) { Speak("Scanning cancelled."); destroyWindow("QR Scanner"); return ""; }
+    }
+}
+
+// === Live guidance: update the pose every frame, redraw it on the route map and speak the way to the next node ===
+void runLiveGuidance(VideoCapture& cap, QRLocalizer& localizer, const Mat& routeMap, const vector<string>& path) {
+    if (!localizer.isCalibrated()) { waitKey(0); return; }
+    localizer.reset(); // Tracks from the scanner are stale after the route narration
+    Speak("Live guidance started. Keep a QR code in view of the camera.");
+    auto lastSpokenTime = chrono::steady_clock::now();
+    bool hadPose = false;
+    Mat frame;
+    while (true) {
+        cap >> frame;
+        if (frame.empty()) { cerr << "Camera feed lost." << endl; Speak("Camera feed lost."); waitKey(0); return; }
+        string location;
+        MapPose userPose = localizeFrame(detectQRCodes(frame), localizer, location);
+        Mat view = routeMap.clone();
+        drawUserPose(view, userPose);
+        imshow("Floor Map Route", view);
+
+        auto currentTime = chrono::steady_clock::now();
+        if (userPose.valid && chrono::duration_cast<chrono::seconds>(currentTime - lastSpokenTime).count() >= SPEECH_DELAY_SECONDS) {
+            size_t next = nextRouteIndex(path, userPose);
+            Point target = nodeCoordinates.at(path[next]);
+            if (next + 1 == path.size() && norm(Point2f(target) - userPose.position) < ARRIVAL_RADIUS_M * localizer.pixelsPerMeter()) {
+                Speak("You have arrived at " + path[next] + ".");
+            }
+            else {
+                Speak(describeTarget(userPose, path[next], target, localizer.pixelsPerMeter()));
+            }
+            lastSpokenTime = currentTime;
+        }
+        else if (!userPose.valid && hadPose) {
+            Speak("Position lost. Point the camera at a QR code.");
+        }
+        hadPose = userPose.valid;
+
+        if (waitKey(50) >= 0) return;
     }
 }
 
 int main(int argc, char* argv[]) {
+    // Synthetic accuracy checks and pose timing; needs no camera, speech or map
+    if (argc > 1 && string(argv[1]) == "--self-test") {
+        return runLocalizationSelfTest() ? 0 : 1;
+    }
+
     // Robust Path Resolution for the map image
     std::filesystem::path exe_path = argv[0];
     std::filesystem::path map_dir = exe_path.parent_path();
@@ -206,6 +346,10 @@ int main(int argc, char* argv[]) {
     InitializeSpeechRecognition(destinationNodes);
     srand(time(0));
 
+    // Camera intrinsics and QR placement for pose estimation; without them feedback falls back to box width
+    QRLocalizer localizer;
+    localizer.loadCalibration((map_dir / "camera_calibration.yml").string(), nodeCoordinates);
+
     // Initialize hardware
     VideoCapture cap(0);
     if (!cap.isOpened()) {
@@ -214,6 +358,10 @@ int main(int argc, char* argv[]) {
         CleanupTTS();
         return -1;
     }
+    // Some backends report 0x0 until a frame has been read, so check the intrinsics against a real frame
+    Mat firstFrame;
+    cap >> firstFrame;
+    localizer.matchImageSize(firstFrame.size());
 
     // Initialize data structures
     RoutePlanner planner;
@@ -228,7 +376,7 @@ int main(int argc, char* argv[]) {
         int choice = getUserChoice();
 
         if (choice == 1) { // Start Navigation (Random Destination)
-            currentLocation = startScanningSequence(cap);
+            currentLocation = startScanningSequence(cap, localizer);
             if (!currentLocation.empty()) {
                 do {
                     destination = destinationNodes[rand() % destinationNodes.size()];
@@ -244,10 +392,11 @@ int main(int argc, char* argv[]) {
                 else {
                     string narration = generateRouteNarration(currentPath);
                     Speak(narration);
-                    bool mapShown = drawRouteOnMap(currentPath, map_path_str, currentLocation, destination);
+                    Mat routeMap;
+                    bool mapShown = drawRouteOnMap(currentPath, map_path_str, currentLocation, destination, routeMap);
                     if (mapShown) {
                         Speak("The visual map is now displayed. Press any key on the map window to close it.");
-                        waitKey(0);
+                        runLiveGuidance(cap, localizer, routeMap, currentPath);
                         try {
                             destroyWindow("Floor Map Route");
                         } catch (const cv::Exception& e) {
@@ -258,7 +407,7 @@ int main(int argc, char* argv[]) {
             }
         }
         else if (choice == 2) { // Where am I?
-            currentLocation = startScanningSequence(cap);
+            currentLocation = startScanningSequence(cap, localizer);
         }
         else if (choice == 3) { // Set Destination by Voice
             Speak("Please say your desired destination now.");
@@ -270,7 +419,7 @@ int main(int argc, char* argv[]) {
             else {
                 Speak("I heard " + spokenDest + ". Is this correct? Please scan your current location to confirm.");
 
-                currentLocation = startScanningSequence(cap);
+                currentLocation = startScanningSequence(cap, localizer);
 
                 // **THE FIX IS HERE**
                 // If the user cancelled the scan, just go back to the main menu
@@ -295,9 +444,10 @@ int main(int argc, char* argv[]) {
                 else {
                     string narration = generateRouteNarration(currentPath);
                     Speak(narration);
-                    drawRouteOnMap(currentPath, map_path_str, currentLocation, destination);
+                    Mat routeMap;
+                    drawRouteOnMap(currentPath, map_path_str, currentLocation, destination, routeMap);
                     Speak("The visual map is now displayed. Press any key on the map window to close it.");
-                    waitKey(0);
+                    runLiveGuidance(cap, localizer, routeMap, currentPath);
                     try {
                         destroyWindow("Floor Map Route");
                     } catch (const cv::Exception& e) {
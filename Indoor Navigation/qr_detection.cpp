@@ -1,13 +1,34 @@
 #include "qr_detection.h"
+#include <algorithm>
+#include <cmath>
 
-QRCodeResult findAndWarpQRCode(const cv::Mat& frame, const cv::Mat& mask) {
+// Corners of the straightened image, in the same order as QRCodeResult::corners
+static const std::vector<cv::Point2f> WARP_CORNERS = { {0.0f, 0.0f}, {200.0f, 0.0f}, {200.0f, 200.0f}, {0.0f, 200.0f} };
+
+// Orders four quad corners as TL, TR, BR, BL in the image. approxPolyDP can start anywhere and
+// wind either way; a consistent order keeps the warp unmirrored. alignCornersToCode fixes the rotation.
+static std::vector<cv::Point2f> orderCorners(const std::vector<cv::Point>& quad) {
+    std::vector<cv::Point2f> pts(quad.begin(), quad.end());
+    cv::Point2f center = (pts[0] + pts[1] + pts[2] + pts[3]) * 0.25f;
+    std::sort(pts.begin(), pts.end(), [&](const cv::Point2f& a, const cv::Point2f& b) {
+        return std::atan2(a.y - center.y, a.x - center.x) < std::atan2(b.y - center.y, b.x - center.x);
+        });
+    auto topLeft = std::min_element(pts.begin(), pts.end(), [](const cv::Point2f& a, const cv::Point2f& b) {
+        return a.x + a.y < b.x + b.y;
+        });
+    std::rotate(pts.begin(), topLeft, pts.end());
+    return pts;
+}
+
+std::vector<QRCodeResult> findAllQRCodes(const cv::Mat& frame, const cv::Mat& mask) {
+    std::vector<QRCodeResult> results;
     std::vector<std::vector<cv::Point>> contours;
     findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
     std::sort(contours.begin(), contours.end(), [](const auto& a, const auto& b) {
         return contourArea(a) > contourArea(b);
         });
     for (const auto& contour : contours) {
-        if (contourArea(contour) < 1000) { continue; }
+        if (contourArea(contour) < 1000) { break; }
         std::vector<cv::Point> approx;
         double peri = arcLength(contour, true);
         approxPolyDP(contour, approx, 0.04 * peri, true);
@@ -15,13 +36,29 @@ QRCodeResult findAndWarpQRCode(const cv::Mat& frame, const cv::Mat& mask) {
             QRCodeResult result;
             result.boundingBox = boundingRect(approx);
             result.pixelWidth = result.boundingBox.width;
-            std::vector<cv::Point2f> dest_pts = { {0.0f, 0.0f}, {200.0f, 0.0f}, {200.0f, 200.0f}, {0.0f, 200.0f} };
-            std::vector<cv::Point2f> src_pts;
-            for (const auto& p : approx) src_pts.push_back(p);
-            cv::Mat transform = getPerspectiveTransform(src_pts, dest_pts);
+            result.corners = orderCorners(approx);
+            cv::Mat transform = getPerspectiveTransform(result.corners, WARP_CORNERS);
             warpPerspective(frame, result.warpedImage, transform, { 200, 200 });
-            return result;
+            results.push_back(result);
         }
     }
-    return {};
+    return results;
+}
+
+QRCodeResult findAndWarpQRCode(const cv::Mat& frame, const cv::Mat& mask) {
+    std::vector<QRCodeResult> results = findAllQRCodes(frame, mask);
+    if (results.empty()) return {};
+    return results.front();
+}
+
+std::vector<cv::Point2f> alignCornersToCode(const std::vector<cv::Point2f>& corners, const std::vector<cv::Point2f>& warpedCodePoints) {
+    if (corners.size() != 4 || warpedCodePoints.size() != 4) return corners;
+    // The warp corner nearest the code's top-left tells how far the code is turned in the image
+    size_t turn = 0;
+    for (size_t i = 1; i < WARP_CORNERS.size(); ++i) {
+        if (cv::norm(warpedCodePoints[0] - WARP_CORNERS[i]) < cv::norm(warpedCodePoints[0] - WARP_CORNERS[turn])) turn = i;
+    }
+    std::vector<cv::Point2f> aligned = corners;
+    std::rotate(aligned.begin(), aligned.begin() + turn, aligned.end());
+    return aligned;
 }
\ No newline at end of file
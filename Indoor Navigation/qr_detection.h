@@ -5,12 +5,22 @@
 
 // A structure to hold the result of a successful QR code detection
 struct QRCodeResult {
-    cv::Mat warpedImage;      // The straightened, flat image for decoding
-    cv::Rect boundingBox;     // The original bounding box in the frame
-    float pixelWidth = 0.0f;  // The width for distance estimation
+    cv::Mat warpedImage;               // The straightened, flat image for decoding
+    cv::Rect boundingBox;              // The original bounding box in the frame
+    std::vector<cv::Point2f> corners;  // Outer corners in the frame, ordered TL, TR, BR, BL as seen in the image
+    float pixelWidth = 0.0f;           // The width for distance estimation
     bool isValid() const { return !warpedImage.empty(); }
 };
 
 // Finds a potential QR code based on a color mask, corrects its perspective,
 // and returns the result.
-QRCodeResult findAndWarpQRCode(const cv::Mat& frame, const cv::Mat& mask);
\ No newline at end of file
+QRCodeResult findAndWarpQRCode(const cv::Mat& frame, const cv::Mat& mask);
+
+// Same as findAndWarpQRCode, but returns every candidate in the mask (largest first)
+// so that several codes in view can be localized against at once.
+std::vector<QRCodeResult> findAllQRCodes(const cv::Mat& frame, const cv::Mat& mask);
+
+// Rotates corners from findAllQRCodes so that corners[0] is the code's printed top-left, using the
+// points readQRCode reports on warpedImage. Image order alone is 90 degrees off once the camera
+// rolls past 45 degrees or the code is mounted rotated.
+std::vector<cv::Point2f> alignCornersToCode(const std::vector<cv::Point2f>& corners, const std::vector<cv::Point2f>& warpedCodePoints);
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "qr_reader.h"
 
 std::string readQRCode(const cv::Mat& frame) {
+    std::vector<cv::Point2f> codePoints;
+    return readQRCode(frame, codePoints);
+}
+
+std::string readQRCode(const cv::Mat& frame, std::vector<cv::Point2f>& codePoints) {
     cv::QRCodeDetector detector;
-    std::string decoded = detector.detectAndDecode(frame);
+    std::string decoded = detector.detectAndDecode(frame, codePoints);
     return decoded;
 }
\ No newline at end of file
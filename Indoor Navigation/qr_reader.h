@@ -1,5 +1,9 @@
 #pragma once
 #include <opencv2/opencv.hpp>
 #include <string>
+#include <vector>
 
-std::string readQRCode(const cv::Mat& frame);
\ No newline at end of file
+std::string readQRCode(const cv::Mat& frame);
+
+// Also returns the code's corners in the frame, starting at its printed top-left and going clockwise.
+std::string readQRCode(const cv::Mat& frame, std::vector<cv::Point2f>& codePoints);
\ No newline at end of file